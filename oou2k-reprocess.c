@@ -0,0 +1,162 @@
+/* oou2k-reprocess.c - reprocess recorded raw spectra with new calibration
+ * Copyright (C) 2026 The liboousb2k authors
+ * All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <usb.h>
+#include "oousb2k.h"
+
+static void
+usage()
+{
+  fprintf(stderr,
+	  "oou2k-reprocess [options] [raw files...]\n"
+	  "\n"
+	  "Converts raw frames (%d native 16 bit counts each) like\n"
+	  "usb2000_get_spectrum() and writes %d doubles per frame.\n"
+	  "Reads stdin if no files are given.\n"
+	  "\n"
+	  "Options:\n"
+	  "    -l l0,l1,l2,l3   wavelength coefficients\n"
+	  "    -c c0,c1,...     linearity correction coefficients (up to 8)\n"
+	  "    -w file          write wavelength axis (one per line) to file\n"
+	  "    -o file          output file (default stdout)\n"
+	  "    -j n             number of threads (default: number of cpus)\n"
+	  "    -h               this help\n",
+	  USB2000_FMT_BINS, USB2000_FMT_BINS);
+}
+
+/* parse up to @a max comma separated numbers, returns count or -1 */
+static int
+parse_list(const char *s, double *arr, int max)
+{
+  int n = 0;
+  char *end;
+
+  while (*s) {
+    if (n == max) return -1;
+    arr[n++] = strtod(s, &end);
+    if (end == s) return -1;
+    s = end;
+    if (*s == ',') s++;
+    else if (*s) return -1;
+  }
+
+  return n;
+}
+
+int
+main(int argc, char **argv)
+{
+  int c, i;
+  int flags = 0;
+  int threads = 0;
+  long frames, total = 0;
+  char *wfile = NULL;
+  FILE *out = stdout;
+
+  struct usb2000_device dev;
+
+  memset(&dev, 0, sizeof(dev));
+
+  while ((c = getopt(argc, argv, "l:c:w:o:j:h")) != -1) {
+    switch (c) {
+    case 'l':
+      if (parse_list(optarg, dev.lambda, 4) < 0) {
+	fprintf(stderr, "Bad wavelength coefficients: %s\n", optarg);
+	exit(-1);
+      }
+      break;
+    case 'c':
+      if ((dev.calib_order = parse_list(optarg, dev.calib, 8)) < 0) {
+	fprintf(stderr, "Bad linearity coefficients: %s\n", optarg);
+	exit(-1);
+      }
+      flags |= USB2000_REPROCESS_LINEAR;
+      break;
+    case 'w':
+      wfile = optarg;
+      break;
+    case 'o':
+      if (!(out = fopen(optarg, "wb"))) {
+	fprintf(stderr, "Cannot open %s: %s\n", optarg, strerror(errno));
+	exit(-1);
+      }
+      break;
+    case 'j':
+      threads = atoi(optarg);
+      break;
+    case 'h':
+      usage();
+      exit(0);
+    default:
+      usage();
+      exit(-1);
+    }
+  }
+
+  if (threads < 1) threads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (threads < 1) threads = 1;
+
+  if (wfile) {
+    double lambda[USB2000_FMT_BINS];
+    FILE *wf = fopen(wfile, "w");
+
+    if (!wf) {
+      fprintf(stderr, "Cannot open %s: %s\n", wfile, strerror(errno));
+      exit(-1);
+    }
+    usb2000_get_wavelength(&dev, lambda);
+    for(i=0; i<USB2000_FMT_BINS; i++) fprintf(wf, "%.6f\n", lambda[i]);
+    fclose(wf);
+  }
+
+  if (optind == argc) {
+    total = usb2000_reprocess(&dev, stdin, out, threads, flags);
+    if (total < 0) {
+      fprintf(stderr, "Reprocessing stdin failed: %s\n", strerror(errno));
+      exit(-1);
+    }
+  }
+
+  for(i=optind; i<argc; i++) {
+    FILE *in = fopen(argv[i], "rb");
+
+    if (!in) {
+      fprintf(stderr, "Cannot open %s: %s\n", argv[i], strerror(errno));
+      exit(-1);
+    }
+    frames = usb2000_reprocess(&dev, in, out, threads, flags);
+    fclose(in);
+    if (frames < 0) {
+      fprintf(stderr, "Reprocessing %s failed: %s\n", argv[i], strerror(errno));
+      exit(-1);
+    }
+    total += frames;
+  }
+
+  if (fclose(out)) {
+    fprintf(stderr, "Writing output failed: %s\n", strerror(errno));
+    exit(-1);
+  }
+
+  fprintf(stderr, "%ld frames reprocessed\n", total);
+  return 0;
+}
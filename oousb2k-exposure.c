@@ -0,0 +1,151 @@
+/* oousb2k-exposure.c - automatic integration time control, see oousb2k.h
+ *
+ * Copyright (C) 2026 The liboousb2k authors
+ * All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#include <math.h>
+
+#include "oousb2k.h"
+
+/* limits of usb2000_set_integration_time() */
+#define ITIME_MIN     3
+#define ITIME_MAX 65535
+
+#define FULL_SCALE ((1<<USB2000_FMT_BITS)-1)
+
+/* largest factor the integration time may grow in one step; keeps a
+   frame of pure dark noise from throwing us straight into saturation */
+#define MAX_GROWTH   10
+/* step down factor when saturated without a known good time */
+#define SAT_SHRINK    8
+
+void
+usb2000_exposure_init(struct usb2000_exposure *ae, int roi_start, int roi_end)
+{
+  if (roi_start < 0) roi_start = 0;
+  if ((roi_end <= roi_start) || (roi_end > USB2000_FMT_BINS))
+    roi_end = USB2000_FMT_BINS;
+
+  ae->roi_start = roi_start;
+  ae->roi_end = roi_end;
+  ae->target = 0.8;
+  ae->tolerance = 0.05;
+  ae->dark = 0;
+  ae->min_itime = ITIME_MIN;
+  ae->max_itime = ITIME_MAX;
+
+  ae->lo = 0;
+  ae->hi = ITIME_MAX + 1;
+  ae->peak = 0;
+  ae->frames = 0;
+  ae->converged = 0;
+}
+
+int
+usb2000_exposure_update(struct usb2000_exposure *ae, const u_int16_t *arr, int itime)
+{
+  int i;
+  int peak = 0;
+  int next;
+  int min_itime = (ae->min_itime < ITIME_MIN) ? ITIME_MIN : ae->min_itime;
+  int max_itime = (ae->max_itime > ITIME_MAX) ? ITIME_MAX : ae->max_itime;
+  double goal = ae->target*FULL_SCALE;
+
+  /* peak search in region of interest */
+  for(i=ae->roi_start; i<ae->roi_end; i++)
+    peak = (arr[i] > peak) ? arr[i] : peak;
+  ae->peak = peak;
+  ae->converged = 0;
+
+  if (peak >= FULL_SCALE) {
+    /* saturated: the peak tells us nothing about the real level, so
+       bisect towards the longest time known to be unsaturated */
+    if (itime < ae->hi) ae->hi = itime;
+    /* saturating at a time that used to be fine: the scene got
+       brighter, forget the stale bound */
+    if (itime <= ae->lo) ae->lo = 0;
+
+    if (ae->lo > 0) next = (ae->lo + ae->hi)/2;
+    else next = itime/SAT_SHRINK;
+  }
+  else {
+    double signal = (double) (peak - ae->dark);
+
+    if (itime > ae->lo) ae->lo = itime;
+    /* likewise for a scene that got darker: the known saturating time
+       would not saturate anymore at the current level */
+    if ((itime >= ae->hi) ||
+	(ae->dark + signal*ae->hi/itime < FULL_SCALE))
+      ae->hi = ITIME_MAX + 1;
+    if (fabs(peak - goal) <= ae->tolerance*FULL_SCALE) {
+      ae->converged = 1;
+      return itime;
+    }
+
+    /* detector response is linear in integration time */
+    if (signal < 1.0) signal = 1.0;
+    next = (int) floor(itime*(goal - ae->dark)/signal + 0.5);
+    if (next > itime*MAX_GROWTH) next = itime*MAX_GROWTH;
+    if (next > max_itime) next = max_itime;
+
+    /* never step (back) into a time known to saturate */
+    if (next >= ae->hi) next = (itime + ae->hi)/2;
+  }
+
+  if (next < min_itime) next = min_itime;
+  if (next > max_itime) next = max_itime;
+
+  /* pinned at a limit (or bracket collapsed): cannot do any better,
+     unless the frame is clipped, which is never a success */
+  if ((next == itime) && (peak < FULL_SCALE)) ae->converged = 1;
+
+  return next;
+}
+
+int
+usb2000_autoexpose(struct usb2000_device *dev, struct usb2000_exposure *ae,
+		   u_int16_t *arr, int max_frames)
+{
+  int next;
+
+  ae->lo = 0;
+  ae->hi = ITIME_MAX + 1;
+  ae->converged = 0;
+
+  for(ae->frames=0; ae->frames<max_frames; ) {
+    /* a failed transfer leaves arr stale, never judge on that */
+    if (usb2000_get_spectrum_raw_quality(dev, arr, NULL)) return -1;
+    ae->frames++;
+
+    next = usb2000_exposure_update(ae, arr, dev->itime);
+    if (ae->converged) return 0;
+
+    /* saturated at the shortest time allowed */
+    if (next == dev->itime) break;
+
+    if (usb2000_set_integration_time(dev, next)) return -1;
+  }
+
+  errno = ERANGE;
+  return -1;
+}
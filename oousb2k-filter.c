@@ -0,0 +1,237 @@
+/* oousb2k-filter.c - smoothing and derivative filters, see oousb2k.h
+ *
+ * Copyright (C) 2026 The liboousb2k authors
+ * All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include "oousb2k.h"
+
+#define D(n) ((double) n)
+
+/* Savitzky-Golay weights for evaluating the @a deriv-th derivative at
+   window position @a r: least squares fit of a polynomial of @a order,
+   i.e. deriv! * row @a deriv of (J^T J)^-1 J^T. Positions are scaled
+   by @a half to keep J^T J well conditioned. Returns -1 on failure. */
+static int
+savgol_row(double *w, int width, int r, int half, int order, int deriv)
+{
+  int i, j, k, m = order+1;
+  double *A, *z;
+  double s = D(half), f = 1.0;
+
+  A = (double *) malloc(m*(m+1)*sizeof(double));
+  if (!A) return -1;
+  z = A + m*m;
+
+  /* normal equations A z = e_deriv */
+  for(i=0; i<m; i++) {
+    for(k=0; k<m; k++) {
+      double sum = 0.0;
+      for(j=0; j<width; j++) sum += pow(D(j-r)/s, i+k);
+      A[i*m+k] = sum;
+    }
+    z[i] = (i == deriv) ? 1.0 : 0.0;
+  }
+
+  /* gaussian elimination, partial pivoting */
+  for(k=0; k<m; k++) {
+    int p = k;
+    for(i=k+1; i<m; i++)
+      if (fabs(A[i*m+k]) > fabs(A[p*m+k])) p = i;
+    if (A[p*m+k] == 0.0) {
+      free(A);
+      return -1;
+    }
+    if (p != k) {
+      double t;
+      for(j=0; j<m; j++) {
+	t = A[k*m+j]; A[k*m+j] = A[p*m+j]; A[p*m+j] = t;
+      }
+      t = z[k]; z[k] = z[p]; z[p] = t;
+    }
+    for(i=k+1; i<m; i++) {
+      double q = A[i*m+k]/A[k*m+k];
+      for(j=k; j<m; j++) A[i*m+j] -= q*A[k*m+j];
+      z[i] -= q*z[k];
+    }
+  }
+  for(k=m-1; k>=0; k--) {
+    for(j=k+1; j<m; j++) z[k] -= A[k*m+j]*z[j];
+    z[k] /= A[k*m+k];
+  }
+
+  for(i=2; i<=deriv; i++) f *= D(i);
+  f /= pow(s, deriv);
+
+  for(j=0; j<width; j++) {
+    double u = D(j-r)/s, p = 1.0, sum = 0.0;
+    for(i=0; i<m; i++) {
+      sum += z[i]*p;
+      p *= u;
+    }
+    w[j] = f*sum;
+  }
+
+  free(A);
+  return 0;
+}
+
+/* boxcar/gaussian truncated to the window, renormalized at the edges */
+static void
+smooth_row(double *w, int width, int r, int half, int type)
+{
+  int j;
+  double sigma = (half > 1) ? 0.5*D(half) : 1.0;
+  double sum = 0.0;
+
+  for(j=0; j<width; j++) {
+    int d = j - r;
+    if ((d < -half) || (d > half)) w[j] = 0.0;
+    else if (type == USB2000_FILTER_BOXCAR) w[j] = 1.0;
+    else w[j] = exp(-0.5*D(d*d)/(sigma*sigma));
+    sum += w[j];
+  }
+  for(j=0; j<width; j++) w[j] /= sum;
+}
+
+struct usb2000_filter *
+usb2000_filter_create(int type, int half, int order, int deriv)
+{
+  int r;
+  int width = 2*half+1;
+  struct usb2000_filter *f;
+
+  if ((half < 1) || (width > USB2000_FMT_BINS) ||
+      ((type != USB2000_FILTER_SAVGOL) && (type != USB2000_FILTER_BOXCAR) &&
+       (type != USB2000_FILTER_GAUSSIAN)) ||
+      ((type == USB2000_FILTER_SAVGOL) &&
+       ((order < 0) || (order >= width) || (deriv < 0) || (deriv > order))) ||
+      ((type != USB2000_FILTER_SAVGOL) && (deriv != 0))) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  f = (struct usb2000_filter *) malloc(sizeof(struct usb2000_filter));
+  if (!f) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  memset(f, 0, sizeof(struct usb2000_filter));
+
+  f->type = type;
+  f->half = half;
+  f->order = order;
+  f->deriv = deriv;
+
+  f->coeff = (double *) malloc(width*width*sizeof(double));
+  if (!f->coeff) {
+    usb2000_filter_destroy(f);
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  for(r=0; r<width; r++) {
+    if (type == USB2000_FILTER_SAVGOL) {
+      if (savgol_row(f->coeff + r*width, width, r, half, order, deriv)) {
+	usb2000_filter_destroy(f);
+	errno = EINVAL;
+	return NULL;
+      }
+    }
+    else {
+      smooth_row(f->coeff + r*width, width, r, half, type);
+    }
+  }
+
+  return f;
+}
+
+void
+usb2000_filter_destroy(struct usb2000_filter *f)
+{
+  if (f->coeff) free(f->coeff);
+  free(f);
+}
+
+/* @a src and @a out must not overlap */
+static void
+filter_frame(const struct usb2000_filter *f, const double *src, double *out)
+{
+  int i, j;
+  int h = f->half, width = 2*f->half+1;
+  const int n = USB2000_FMT_BINS;
+  const double *c = f->coeff + h*width;
+
+  /* centre: tap-outer, pixel-inner, so the inner loop is a plain
+     vectorizable multiply-add over contiguous memory */
+  for(i=h; i<n-h; i++) out[i] = 0.0;
+  for(j=0; j<width; j++) {
+    const double cj = c[j];
+    const double *s = src + j - h;
+    for(i=h; i<n-h; i++) out[i] += cj*s[i];
+  }
+
+  /* edges: window pinned to the first/last pixels */
+  for(i=0; i<h; i++) {
+    const double *cl = f->coeff + i*width;
+    const double *cr = f->coeff + (width-h+i)*width;
+    double sl = 0.0, sr = 0.0;
+    for(j=0; j<width; j++) {
+      sl += cl[j]*src[j];
+      sr += cr[j]*src[n-width+j];
+    }
+    out[i] = sl;
+    out[n-h+i] = sr;
+  }
+}
+
+void
+usb2000_filter_apply(const struct usb2000_filter *f, const double *in, double *out, int n)
+{
+  int k;
+  double tmp[USB2000_FMT_BINS];
+
+  for(k=0; k<n; k++, in+=USB2000_FMT_BINS, out+=USB2000_FMT_BINS) {
+    const double *src = in;
+
+    if ((out < in + USB2000_FMT_BINS) && (in < out + USB2000_FMT_BINS)) {
+      memcpy(tmp, in, sizeof(tmp));
+      src = tmp;
+    }
+    filter_frame(f, src, out);
+  }
+}
+
+void
+usb2000_filter_apply_raw(const struct usb2000_filter *f, const u_int16_t *in, double *out, int n)
+{
+  int i, k;
+  double tmp[USB2000_FMT_BINS];
+
+  for(k=0; k<n; k++, in+=USB2000_FMT_BINS, out+=USB2000_FMT_BINS) {
+    for(i=0; i<USB2000_FMT_BINS; i++) tmp[i] = D(in[i]);
+    filter_frame(f, tmp, out);
+  }
+}
@@ -0,0 +1,307 @@
+/* oousb2k-match.c - spectral library matching, see oousb2k.h
+ *
+ * Copyright (C) 2026 The liboousb2k authors
+ * All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "oousb2k.h"
+
+#define D(n) ((double) n)
+
+#define BLOCKS     USB2000_MATCH_BLOCKS
+#define BLOCK_SIZE (USB2000_FMT_BINS/USB2000_MATCH_BLOCKS)
+
+/* fewer references than this per thread are not worth a thread */
+#define MIN_PER_THREAD 256
+
+struct match_job
+{
+  const struct usb2000_library *lib;
+  const double *x;               /* normalized query */
+  const double *xtail;           /* query tail norms */
+  int begin, end;
+  int k;
+  struct usb2000_match *best;    /* sorted, best first */
+  int nbest;
+};
+
+/* normalize @a v in place for @a metric, then fill BLOCKS+1 tail norms
+   (norm of v[b*BLOCK_SIZE...], the last being 0) */
+static void
+match_prepare(int metric, double *v, double *tail)
+{
+  int i, b;
+  double sum;
+
+  if (metric == USB2000_MATCH_CORRELATION) {
+    sum = 0.0;
+    for(i=0; i<USB2000_FMT_BINS; i++) sum += v[i];
+    sum /= D(USB2000_FMT_BINS);
+    for(i=0; i<USB2000_FMT_BINS; i++) v[i] -= sum;
+  }
+
+  if (metric != USB2000_MATCH_EUCLIDEAN) {
+    sum = 0.0;
+    for(i=0; i<USB2000_FMT_BINS; i++) sum += v[i]*v[i];
+    sum = (sum > 0.0) ? 1.0/sqrt(sum) : 0.0;
+    for(i=0; i<USB2000_FMT_BINS; i++) v[i] *= sum;
+  }
+
+  tail[BLOCKS] = 0.0;
+  for(b=BLOCKS-1; b>=0; b--) {
+    const double *vb = v + b*BLOCK_SIZE;
+    sum = tail[b+1]*tail[b+1];
+    for(i=0; i<BLOCK_SIZE; i++) sum += vb[i]*vb[i];
+    tail[b] = sqrt(sum);
+  }
+}
+
+struct usb2000_library *
+usb2000_library_create(struct usb2000_device *dev, int metric, int threads)
+{
+  struct usb2000_library *lib;
+
+  if ((metric != USB2000_MATCH_COSINE) && (metric != USB2000_MATCH_CORRELATION) &&
+      (metric != USB2000_MATCH_EUCLIDEAN)) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  lib = (struct usb2000_library *) malloc(sizeof(struct usb2000_library));
+  if (!lib) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  memset(lib, 0, sizeof(struct usb2000_library));
+
+  lib->metric = metric;
+  lib->threads = (threads < 1) ? 1 : threads;
+  usb2000_get_wavelength(dev, lib->wl);
+
+  return lib;
+}
+
+void
+usb2000_library_destroy(struct usb2000_library *lib)
+{
+  if (lib->ref) free(lib->ref);
+  if (lib->tail) free(lib->tail);
+  free(lib);
+}
+
+int
+usb2000_library_add(struct usb2000_library *lib, const double *wl, const double *val, int len)
+{
+  int i, j;
+  double *r;
+
+  if ((wl && (len < 2)) || (!wl && (len != USB2000_FMT_BINS))) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (lib->n == lib->size) {
+    int size = lib->size ? 2*lib->size : 64;
+    double *ref = (double *) realloc(lib->ref, (size_t) size*USB2000_FMT_BINS*sizeof(double));
+    double *tail;
+
+    if (!ref) {
+      errno = ENOMEM;
+      return -1;
+    }
+    lib->ref = ref;
+
+    tail = (double *) realloc(lib->tail, size*(BLOCKS+1)*sizeof(double));
+    if (!tail) {
+      errno = ENOMEM;
+      return -1;
+    }
+    lib->tail = tail;
+    lib->size = size;
+  }
+
+  r = lib->ref + (size_t) lib->n*USB2000_FMT_BINS;
+
+  if (!wl) {
+    memcpy(r, val, USB2000_FMT_BINS*sizeof(double));
+  }
+  else {
+    /* linear interpolation onto the device axis (both sorted, one
+       merged walk), held constant beyond the reference's ends */
+    for(i=0, j=0; i<USB2000_FMT_BINS; i++) {
+      double x = lib->wl[i];
+
+      if (x <= wl[0]) r[i] = val[0];
+      else if (x >= wl[len-1]) r[i] = val[len-1];
+      else {
+	while (wl[j+1] < x) j++;
+	r[i] = val[j] + (val[j+1] - val[j])*(x - wl[j])/(wl[j+1] - wl[j]);
+      }
+    }
+  }
+
+  match_prepare(lib->metric, r, lib->tail + lib->n*(BLOCKS+1));
+
+  return lib->n++;
+}
+
+static inline void
+match_insert(struct match_job *job, int index, double score)
+{
+  int i;
+
+  if (job->nbest < job->k) job->nbest++;
+  else if (score <= job->best[job->k-1].score) return;
+
+  for(i=job->nbest-1; (i>0) && (job->best[i-1].score < score); i--)
+    job->best[i] = job->best[i-1];
+  job->best[i].index = index;
+  job->best[i].score = score;
+}
+
+/* scores are kept "higher is better" (negative squared distance for
+   USB2000_MATCH_EUCLIDEAN). After every block the best score the rest
+   could still reach is bounded by Cauchy-Schwarz (resp. the reverse
+   triangle inequality) on the tail norms; references that cannot
+   beat the current k-th best are dropped right there. */
+static void *
+match_run(void *arg)
+{
+  struct match_job *job = (struct match_job *) arg;
+  const struct usb2000_library *lib = job->lib;
+  const double *x = job->x, *xt = job->xtail;
+  int euclid = (lib->metric == USB2000_MATCH_EUCLIDEAN);
+  int n, b, i;
+
+  for(n=job->begin; n<job->end; n++) {
+    const double *r = lib->ref + (size_t) n*USB2000_FMT_BINS;
+    const double *rt = lib->tail + n*(BLOCKS+1);
+    double thresh = (job->nbest < job->k) ? -HUGE_VAL : job->best[job->k-1].score;
+    double acc = 0.0;
+
+    for(b=0; b<BLOCKS; b++) {
+      const double *xb = x + b*BLOCK_SIZE, *rb = r + b*BLOCK_SIZE;
+      double s = 0.0, bound;
+
+      if (euclid) {
+	for(i=0; i<BLOCK_SIZE; i++) s += (xb[i] - rb[i])*(xb[i] - rb[i]);
+	acc += s;
+	bound = -(acc + (xt[b+1] - rt[b+1])*(xt[b+1] - rt[b+1]));
+      }
+      else {
+	for(i=0; i<BLOCK_SIZE; i++) s += xb[i]*rb[i];
+	acc += s;
+	bound = acc + xt[b+1]*rt[b+1];
+      }
+
+      if (bound <= thresh) break;
+    }
+
+    if (b == BLOCKS) match_insert(job, n, euclid ? -acc : acc);
+  }
+
+  return NULL;
+}
+
+int
+usb2000_library_match(struct usb2000_library *lib, const double *spectrum, int k,
+		      struct usb2000_match *out)
+{
+  int t, i, nt, nout = 0;
+  double x[USB2000_FMT_BINS];
+  double xtail[BLOCKS+1];
+  struct match_job *job;
+  pthread_t *tid;
+
+  if (k < 1) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (k > lib->n) k = lib->n;
+  if (k == 0) return 0;
+
+  memcpy(x, spectrum, sizeof(x));
+  match_prepare(lib->metric, x, xtail);
+
+  nt = lib->n/MIN_PER_THREAD;
+  if (nt > lib->threads) nt = lib->threads;
+  if (nt < 1) nt = 1;
+
+  job = (struct match_job *) malloc(nt*sizeof(struct match_job));
+  tid = (pthread_t *) malloc(nt*sizeof(pthread_t));
+  if (!job || !tid) {
+    if (job) free(job);
+    if (tid) free(tid);
+    errno = ENOMEM;
+    return -1;
+  }
+  memset(job, 0, nt*sizeof(struct match_job));
+
+  for(t=0; t<nt; t++) {
+    job[t].lib = lib;
+    job[t].x = x;
+    job[t].xtail = xtail;
+    job[t].begin = (int) (((long) lib->n*t)/nt);
+    job[t].end = (int) (((long) lib->n*(t+1))/nt);
+    job[t].k = k;
+    job[t].best = (struct usb2000_match *) malloc(k*sizeof(struct usb2000_match));
+    if (!job[t].best) {
+      errno = ENOMEM;
+      nout = -1;
+      goto match_cleanup;
+    }
+  }
+
+  /* the calling thread takes the first share */
+  for(t=1; t<nt; t++) {
+    if (pthread_create(&tid[t], NULL, match_run, &job[t])) {
+      /* run the rest here */
+      for(i=t; i<nt; i++) match_run(&job[i]);
+      break;
+    }
+  }
+  match_run(&job[0]);
+  for(i=1; i<t; i++) pthread_join(tid[i], NULL);
+
+  /* merge per-thread results */
+  for(t=1; t<nt; t++)
+    for(i=0; i<job[t].nbest; i++)
+      match_insert(&job[0], job[t].best[i].index, job[t].best[i].score);
+
+  nout = job[0].nbest;
+  for(i=0; i<nout; i++) {
+    out[i] = job[0].best[i];
+    if (lib->metric == USB2000_MATCH_EUCLIDEAN)
+      out[i].score = (out[i].score < 0.0) ? sqrt(-out[i].score) : 0.0;
+  }
+
+ match_cleanup:
+  for(t=0; t<nt; t++) free(job[t].best);
+  free(job);
+  free(tid);
+
+  return nout;
+}
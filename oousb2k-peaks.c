@@ -0,0 +1,169 @@
+/* oousb2k-peaks.c - peak detection and tracking, see oousb2k.h
+ *
+ * Copyright (C) 2026 The liboousb2k authors
+ * All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#include <math.h>
+
+#include "oousb2k.h"
+
+static inline double
+lambda_at(struct usb2000_device *dev, double p)
+{
+  return dev->lambda[0]
+    + p*(dev->lambda[1]
+	 + p*(dev->lambda[2]
+	      + p*dev->lambda[3]));
+}
+
+/* fit through (i-1, i, i+1), fill centroid, height and wavelength */
+static void
+peak_fit(struct usb2000_device *dev, const double *s, int i, int mode,
+	 struct usb2000_peak *pk)
+{
+  double a = s[i-1], b = s[i], c = s[i+1];
+  double den, delta = 0.0;
+
+  pk->index = i;
+  pk->height = b;
+
+  if ((mode == USB2000_PEAK_GAUSSIAN) && (a > 0.0) && (b > 0.0) && (c > 0.0)) {
+    a = log(a);
+    b = log(b);
+    c = log(c);
+    den = a - 2.0*b + c;
+    if (den < 0.0) {
+      delta = 0.5*(a - c)/den;
+      pk->height = exp(b - 0.25*(a - c)*delta);
+    }
+  }
+  else {
+    den = a - 2.0*b + c;
+    if (den < 0.0) {
+      delta = 0.5*(a - c)/den;
+      pk->height = b - 0.25*(a - c)*delta;
+    }
+  }
+
+  pk->pixel = (double) i + delta;
+  pk->wavelength = lambda_at(dev, pk->pixel);
+}
+
+/* height above the higher of the minima found walking each way from
+   @a i until the signal rises above s[i] or [lo, hi] is exhausted */
+static double
+peak_prominence(const double *s, int i, int lo, int hi)
+{
+  int j;
+  double top = s[i];
+  double lmin = top, rmin = top;
+
+  for(j=i-1; (j>=lo) && (s[j] <= top); j--)
+    if (s[j] < lmin) lmin = s[j];
+  for(j=i+1; (j<=hi) && (s[j] <= top); j++)
+    if (s[j] < rmin) rmin = s[j];
+
+  return top - ((lmin > rmin) ? lmin : rmin);
+}
+
+int
+usb2000_find_peaks(struct usb2000_device *dev, const double *spectrum,
+		   double threshold, double prominence, int mode,
+		   struct usb2000_peak *peaks, int max)
+{
+  int i, n = 0;
+  unsigned char cand[USB2000_FMT_BINS];
+  const double *s = spectrum;
+
+  /* candidate mask without branches, so this pass vectorizes */
+  cand[0] = cand[USB2000_FMT_BINS-1] = 0;
+  for(i=1; i<USB2000_FMT_BINS-1; i++)
+    cand[i] = (s[i] > s[i-1]) & (s[i] >= s[i+1]) & (s[i] >= threshold);
+
+  for(i=1; (i<USB2000_FMT_BINS-1) && (n<max); i++) {
+    double prom;
+
+    if (!cand[i]) continue;
+
+    prom = peak_prominence(s, i, 0, USB2000_FMT_BINS-1);
+    if (prom < prominence) continue;
+
+    peak_fit(dev, s, i, mode, &peaks[n]);
+    peaks[n].prominence = prom;
+    peaks[n].lost = 0;
+    n++;
+  }
+
+  return n;
+}
+
+int
+usb2000_track_peaks(struct usb2000_device *dev, const double *spectrum,
+		    double threshold, double prominence, int window, int mode,
+		    struct usb2000_peak *peaks, int n)
+{
+  int k, i;
+  int found = 0;
+  const double *s = spectrum;
+
+  if (window < 1) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  for(k=0; k<n; k++) {
+    int lo = peaks[k].index - window;
+    int hi = peaks[k].index + window;
+    int first = (lo < 1) ? 1 : lo;
+    int last = (hi > USB2000_FMT_BINS-2) ? USB2000_FMT_BINS-2 : hi;
+    int top;
+    double prom;
+
+    top = first;
+    for(i=first+1; i<=last; i++)
+      if (s[i] > s[top]) top = i;
+
+    /* maximum on the window border (not the spectrum's): the peak moved
+       away. Otherwise it must still pass the tests of usb2000_find_peaks(),
+       else it sank into the noise. Either way keep the last good values
+       so the next search stays put. */
+    if ((top == lo) || (top == hi) ||
+	!((s[top] > s[top-1]) && (s[top] >= s[top+1]) && (s[top] >= threshold))) {
+      peaks[k].lost = 1;
+      continue;
+    }
+
+    prom = peak_prominence(s, top, 0, USB2000_FMT_BINS-1);
+    if (prom < prominence) {
+      peaks[k].lost = 1;
+      continue;
+    }
+
+    peak_fit(dev, s, top, mode, &peaks[k]);
+    peaks[k].prominence = prom;
+    peaks[k].lost = 0;
+    found++;
+  }
+
+  return found;
+}
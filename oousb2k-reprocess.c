@@ -0,0 +1,215 @@
+/* oousb2k-reprocess.c - parallel reprocessing of recorded raw spectra, see oousb2k.h
+ *
+ * Copyright (C) 2026 The liboousb2k authors
+ * All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "oousb2k.h"
+
+#define FRAME_SIZE (USB2000_FMT_BINS*sizeof(u_int16_t))
+
+/* frames per work item, and work items in flight per thread: memory
+   use is bounded by threads*SLOTS_PER_THREAD*BATCH frames */
+#define BATCH            16
+#define SLOTS_PER_THREAD  4
+
+#define SLOT_FREE  0
+#define SLOT_READY 1
+#define SLOT_BUSY  2
+#define SLOT_DONE  3
+
+struct reprocess_slot
+{
+  int        state;
+  int        frames;
+  u_int16_t  raw[BATCH*USB2000_FMT_BINS];
+  double     out[BATCH*USB2000_FMT_BINS];
+};
+
+struct reprocess_ctx
+{
+  pthread_mutex_t lock;
+  pthread_cond_t  work;          /* a slot became READY (or quit) */
+  pthread_cond_t  done;          /* a slot became DONE */
+
+  struct reprocess_slot *slot;
+  int    nslots;
+  long   next_read;              /* sequence number of the next slot to fill */
+  long   next_work;              /* sequence number of the next slot to process */
+  int    quit;
+
+  double *linear_correction;
+};
+
+static void
+reprocess_batch(struct reprocess_ctx *ctx, struct reprocess_slot *s)
+{
+  int f;
+
+  for(f=0; f<s->frames; f++)
+    usb2000_convert_spectrum(s->raw + f*USB2000_FMT_BINS, ctx->linear_correction,
+			     s->out + f*USB2000_FMT_BINS);
+}
+
+/* workers take slots strictly in sequence from a shared queue, so a
+   slow batch never holds up idle threads */
+static void *
+reprocess_worker(void *arg)
+{
+  struct reprocess_ctx *ctx = (struct reprocess_ctx *) arg;
+  struct reprocess_slot *s;
+
+  pthread_mutex_lock(&ctx->lock);
+  for(;;) {
+    while (!ctx->quit && (ctx->next_work == ctx->next_read))
+      pthread_cond_wait(&ctx->work, &ctx->lock);
+    if (ctx->next_work == ctx->next_read) break;
+
+    s = &ctx->slot[ctx->next_work % ctx->nslots];
+    ctx->next_work++;
+    s->state = SLOT_BUSY;
+    pthread_mutex_unlock(&ctx->lock);
+
+    reprocess_batch(ctx, s);
+
+    pthread_mutex_lock(&ctx->lock);
+    s->state = SLOT_DONE;
+    pthread_cond_broadcast(&ctx->done);
+  }
+  pthread_mutex_unlock(&ctx->lock);
+
+  return NULL;
+}
+
+long
+usb2000_reprocess(struct usb2000_device *dev, FILE *in, FILE *out, int threads, int flags)
+{
+  struct reprocess_ctx ctx;
+  pthread_t *tid;
+  long next_write = 0;
+  long frames = 0;
+  int eof = 0;
+  int status = 0;
+  int rstatus = 0;
+  int t, nt;
+
+  if (threads < 1) threads = 1;
+
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.nslots = threads*SLOTS_PER_THREAD;
+  ctx.slot = (struct reprocess_slot *) malloc(ctx.nslots*sizeof(struct reprocess_slot));
+  tid = (pthread_t *) malloc(threads*sizeof(pthread_t));
+  if (flags & USB2000_REPROCESS_LINEAR) {
+    /* usb2000_get_linear_correction() accumulates into the table */
+    ctx.linear_correction = (double *) calloc(1<<USB2000_FMT_BITS, sizeof(double));
+    if (ctx.linear_correction)
+      usb2000_get_linear_correction(dev, ctx.linear_correction);
+  }
+  if (!ctx.slot || !tid ||
+      ((flags & USB2000_REPROCESS_LINEAR) && !ctx.linear_correction)) {
+    status = ENOMEM;
+    nt = 0;
+    goto reprocess_cleanup;
+  }
+
+  pthread_mutex_init(&ctx.lock, NULL);
+  pthread_cond_init(&ctx.work, NULL);
+  pthread_cond_init(&ctx.done, NULL);
+
+  for(nt=0; nt<threads; nt++)
+    if (pthread_create(&tid[nt], NULL, reprocess_worker, &ctx)) break;
+  if (nt == 0) {
+    status = EAGAIN;
+    goto reprocess_destroy;
+  }
+
+  /* this thread does all I/O: keep the ring full, write in order */
+  for(;;) {
+    struct reprocess_slot *s;
+
+    while (!eof && (ctx.next_read - next_write < ctx.nslots)) {
+      size_t len;
+
+      s = &ctx.slot[ctx.next_read % ctx.nslots];
+      len = fread(s->raw, 1, sizeof(s->raw), in);
+
+      s->frames = len/FRAME_SIZE;
+      if (len < sizeof(s->raw)) {
+	eof = 1;
+	/* a cut off last frame is an error, but the whole ones before
+	   it are still written */
+	if (ferror(in) || (len % FRAME_SIZE)) rstatus = EIO;
+	if (s->frames == 0) break;
+      }
+
+      pthread_mutex_lock(&ctx.lock);
+      s->state = SLOT_READY;
+      ctx.next_read++;
+      pthread_cond_signal(&ctx.work);
+      pthread_mutex_unlock(&ctx.lock);
+    }
+
+    if (next_write == ctx.next_read) break;
+
+    s = &ctx.slot[next_write % ctx.nslots];
+    pthread_mutex_lock(&ctx.lock);
+    while (s->state != SLOT_DONE)
+      pthread_cond_wait(&ctx.done, &ctx.lock);
+    pthread_mutex_unlock(&ctx.lock);
+
+    if (!status &&
+	(fwrite(s->out, USB2000_FMT_BINS*sizeof(double), s->frames, out) != (size_t) s->frames))
+      status = EIO;
+    frames += s->frames;
+    s->state = SLOT_FREE;
+    next_write++;
+
+    /* on error drain what is in flight, but read no more */
+    if (status) eof = 1;
+  }
+
+  pthread_mutex_lock(&ctx.lock);
+  ctx.quit = 1;
+  pthread_cond_broadcast(&ctx.work);
+  pthread_mutex_unlock(&ctx.lock);
+  for(t=0; t<nt; t++) pthread_join(tid[t], NULL);
+
+ reprocess_destroy:
+  pthread_cond_destroy(&ctx.done);
+  pthread_cond_destroy(&ctx.work);
+  pthread_mutex_destroy(&ctx.lock);
+
+ reprocess_cleanup:
+  if (ctx.linear_correction) free(ctx.linear_correction);
+  if (ctx.slot) free(ctx.slot);
+  if (tid) free(tid);
+
+  if (!status) status = rstatus;
+  if (status) {
+    errno = status;
+    return -1;
+  }
+  return frames;
+}
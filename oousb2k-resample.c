@@ -0,0 +1,215 @@
+/* oousb2k-resample.c - resampling onto a uniform wavelength grid, see oousb2k.h
+ *
+ * Copyright (C) 2026 The liboousb2k authors
+ * All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "oousb2k.h"
+
+#define D(n) ((double) n)
+
+static struct usb2000_resample_plan *__usb2000_plans = NULL;
+static pthread_mutex_t __usb2000_plans_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* weights for pixels index..index+taps-1 at fractional pixel j+t */
+static void
+plan_weights(struct usb2000_resample_plan *plan, int k, int j, double t)
+{
+  int    *idx = plan->index + k;
+  double *w = plan->weight + k*plan->taps;
+
+  if (plan->taps == 2) {
+    *idx = j;
+    w[0] = 1.0 - t;
+    w[1] = t;
+    return;
+  }
+
+  if ((j >= 1) && (j+2 < USB2000_FMT_BINS)) {
+    /* Catmull-Rom */
+    double t2 = t*t, t3 = t2*t;
+    *idx = j-1;
+    w[0] = 0.5*(-t3 + 2.0*t2 - t);
+    w[1] = 0.5*(3.0*t3 - 5.0*t2 + 2.0);
+    w[2] = 0.5*(-3.0*t3 + 4.0*t2 + t);
+    w[3] = 0.5*(t3 - t2);
+  }
+  else {
+    /* first/last pixel interval: fall back to linear */
+    *idx = (j < 1) ? 0 : USB2000_FMT_BINS-4;
+    w[0] = w[1] = w[2] = w[3] = 0.0;
+    w[j - *idx] = 1.0 - t;
+    w[j - *idx + 1] = t;
+  }
+}
+
+struct usb2000_resample_plan *
+usb2000_resample_plan_create(struct usb2000_device *dev, double start,
+			     double step, int n, int method)
+{
+  int j, k;
+  double wl[USB2000_FMT_BINS];
+  struct usb2000_resample_plan *plan;
+
+  if ((n < 1) || (step <= 0.0) ||
+      ((method != USB2000_RESAMPLE_LINEAR) && (method != USB2000_RESAMPLE_CUBIC))) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  plan = (struct usb2000_resample_plan *) malloc(sizeof(struct usb2000_resample_plan));
+  if (!plan) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  memset(plan, 0, sizeof(struct usb2000_resample_plan));
+
+  memcpy(plan->serialno, dev->serialno, sizeof(plan->serialno));
+  memcpy(plan->lambda, dev->lambda, sizeof(plan->lambda));
+  plan->start = start;
+  plan->step = step;
+  plan->n = n;
+  plan->method = method;
+  plan->taps = (method == USB2000_RESAMPLE_CUBIC) ? 4 : 2;
+
+  plan->index = (int *) malloc(n*sizeof(int));
+  plan->weight = (double *) malloc(n*plan->taps*sizeof(double));
+  if (!plan->index || !plan->weight) {
+    usb2000_resample_plan_destroy(plan);
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  usb2000_get_wavelength(dev, wl);
+
+  /* the grid is sorted, so a single merged walk over the pixel axis
+     replaces a binary search per grid point */
+  for(j=0, k=0; k<n; k++) {
+    double x = start + D(k)*step;
+
+    if ((x < wl[0]) || (x > wl[USB2000_FMT_BINS-1])) {
+      /* outside the calibrated range */
+      plan_weights(plan, k, 0, 0.0);
+      memset(plan->weight + k*plan->taps, 0, plan->taps*sizeof(double));
+      continue;
+    }
+
+    while ((j < USB2000_FMT_BINS-2) && (wl[j+1] <= x)) j++;
+
+    plan_weights(plan, k, j, (x - wl[j])/(wl[j+1] - wl[j]));
+  }
+
+  return plan;
+}
+
+void
+usb2000_resample_plan_destroy(struct usb2000_resample_plan *plan)
+{
+  if (plan->index) free(plan->index);
+  if (plan->weight) free(plan->weight);
+  free(plan);
+}
+
+struct usb2000_resample_plan *
+usb2000_resample_plan_get(struct usb2000_device *dev, double start,
+			  double step, int n, int method)
+{
+  struct usb2000_resample_plan **pp, *plan;
+
+  pthread_mutex_lock(&__usb2000_plans_lock);
+
+  for(pp=&__usb2000_plans; (plan = *pp); pp=&plan->next)
+    if ((plan->start == start) && (plan->step == step) &&
+	(plan->n == n) && (plan->method == method) &&
+	!strncmp(plan->serialno, dev->serialno, sizeof(plan->serialno)))
+      break;
+
+  /* made before the device was recalibrated: replace it, nobody could
+     get it anymore */
+  if (plan && memcmp(plan->lambda, dev->lambda, sizeof(plan->lambda))) {
+    *pp = plan->next;
+    usb2000_resample_plan_destroy(plan);
+    plan = NULL;
+  }
+
+  if (!plan) {
+    plan = usb2000_resample_plan_create(dev, start, step, n, method);
+    if (plan) {
+      plan->next = __usb2000_plans;
+      __usb2000_plans = plan;
+    }
+  }
+
+  pthread_mutex_unlock(&__usb2000_plans_lock);
+
+  return plan;
+}
+
+void
+usb2000_resample_flush()
+{
+  struct usb2000_resample_plan *ptr;
+  struct usb2000_resample_plan *nxt;
+
+  pthread_mutex_lock(&__usb2000_plans_lock);
+
+  ptr = __usb2000_plans;
+  while (ptr) {
+    nxt = ptr->next;
+    usb2000_resample_plan_destroy(ptr);
+    ptr = nxt;
+  }
+  __usb2000_plans = NULL;
+
+  pthread_mutex_unlock(&__usb2000_plans_lock);
+}
+
+/* the tap count is a constant inside each loop so the inner sums get
+   fully unrolled */
+#define RESAMPLE_LOOP(plan, in, out) {					\
+    int k;								\
+    const int *idx = (plan)->index;					\
+    const double *w = (plan)->weight;					\
+    if ((plan)->taps == 2) {						\
+      for(k=0; k<(plan)->n; k++, w+=2)					\
+	(out)[k] = w[0]*D((in)[idx[k]]) + w[1]*D((in)[idx[k]+1]);	\
+    }									\
+    else {								\
+      for(k=0; k<(plan)->n; k++, w+=4)					\
+	(out)[k] = w[0]*D((in)[idx[k]])   + w[1]*D((in)[idx[k]+1])	\
+	         + w[2]*D((in)[idx[k]+2]) + w[3]*D((in)[idx[k]+3]);	\
+    } }
+
+void
+usb2000_resample(const struct usb2000_resample_plan *plan, const double *in, double *out)
+{
+  RESAMPLE_LOOP(plan, in, out);
+}
+
+void
+usb2000_resample_raw(const struct usb2000_resample_plan *plan, const u_int16_t *in, double *out)
+{
+  RESAMPLE_LOOP(plan, in, out);
+}
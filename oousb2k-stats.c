@@ -0,0 +1,123 @@
+/* oousb2k-stats.c - running per-pixel statistics, see oousb2k.h
+ *
+ * Copyright (C) 2026 The liboousb2k authors
+ * All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+
+#include "oousb2k.h"
+
+#define D(n) ((double) n)
+
+void
+usb2000_stats_init(struct usb2000_stats *st, double alpha)
+{
+  int i;
+
+  st->count = 0;
+  st->alpha = alpha;
+
+  for(i=0; i<USB2000_FMT_BINS; i++) {
+    st->mean[i] = 0.0;
+    st->m2[i] = 0.0;
+    st->ewma[i] = 0.0;
+    st->min[i] = 0xFFFF;
+    st->max[i] = 0;
+  }
+}
+
+/* Welford's update; every loop below is free of branches and data
+   dependencies between pixels so the compiler can vectorize it */
+void
+usb2000_stats_update(struct usb2000_stats *st, const u_int16_t *arr)
+{
+  int i;
+  double rn;
+  double a = st->alpha;
+
+  st->count++;
+  rn = 1.0/D(st->count);
+
+  for(i=0; i<USB2000_FMT_BINS; i++) {
+    double x = D(arr[i]);
+    double d = x - st->mean[i];
+
+    st->mean[i] += d*rn;
+    st->m2[i] += d*(x - st->mean[i]);
+  }
+
+  for(i=0; i<USB2000_FMT_BINS; i++) {
+    st->min[i] = (arr[i] < st->min[i]) ? arr[i] : st->min[i];
+    st->max[i] = (arr[i] > st->max[i]) ? arr[i] : st->max[i];
+  }
+
+  if (a > 0.0) {
+    /* seed with the first frame instead of decaying up from zero */
+    if (st->count == 1) a = 1.0;
+    for(i=0; i<USB2000_FMT_BINS; i++)
+      st->ewma[i] += a*(D(arr[i]) - st->ewma[i]);
+  }
+}
+
+/* Chan et al. pairwise combination. The exponential mean has no
+   meaningful merge, the one of @a dst is kept (if any). */
+void
+usb2000_stats_merge(struct usb2000_stats *dst, const struct usb2000_stats *src)
+{
+  int i;
+  double na, nb, rn;
+
+  if (src->count == 0) return;
+  if (dst->count == 0) {
+    double alpha = dst->alpha;
+    *dst = *src;
+    dst->alpha = alpha;
+    return;
+  }
+
+  na = D(dst->count);
+  nb = D(src->count);
+  rn = 1.0/(na + nb);
+
+  for(i=0; i<USB2000_FMT_BINS; i++) {
+    double d = src->mean[i] - dst->mean[i];
+
+    dst->mean[i] += d*nb*rn;
+    dst->m2[i] += src->m2[i] + d*d*na*nb*rn;
+  }
+
+  for(i=0; i<USB2000_FMT_BINS; i++) {
+    dst->min[i] = (src->min[i] < dst->min[i]) ? src->min[i] : dst->min[i];
+    dst->max[i] = (src->max[i] > dst->max[i]) ? src->max[i] : dst->max[i];
+  }
+
+  dst->count += src->count;
+}
+
+void
+usb2000_stats_variance(const struct usb2000_stats *st, double *arr)
+{
+  int i;
+  double r = (st->count > 1) ? 1.0/D(st->count - 1) : 0.0;
+
+  for(i=0; i<USB2000_FMT_BINS; i++)
+    arr[i] = st->m2[i]*r;
+}
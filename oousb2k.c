@@ -22,9 +22,15 @@
 #endif
 
 #include <stdio.h>
+#include <string.h>
 #include <errno.h>
 #include <math.h>
 #include <endian.h>
+#ifdef HAVE_LINUX_NETLINK_H
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <fcntl.h>
+#endif
 
 #include "oousb2k.h"
 
@@ -117,7 +123,36 @@
 #define SYNC_SIZE      1
 #define PACKET_SIZE   64 /* FIXME HR4000 usb2.0 mode has different packet size */
 
+/* short data packets tolerated per spectrum */
+#define PACKET_RETRIES 8
+
+#define FULL_SCALE ((1<<USB2000_FMT_BITS)-1)
+
+/* device index sizes (power of 2) */
+#define INDEX_SIZE    64
+#define MAX_HOTPLUG    8
+
 static struct usb2000_device *__usb2000_devices = NULL;
+static struct usb2000_device *__usb2000_devices_tail = NULL;
+
+static struct usb2000_device *__usb2000_path_index[INDEX_SIZE];
+static struct usb2000_device *__usb2000_serial_index[INDEX_SIZE];
+
+static struct {
+  usb2000_hotplug_cb cb;
+  void *data;
+} __usb2000_hotplug[MAX_HOTPLUG];
+
+static int __usb2000_scan = 0;
+static int __usb2000_hotplug_sock = -1;
+
+static inline unsigned int
+__usb2000_hash(const char *s)
+{
+  unsigned int h = 5381;
+  while (*s) h = h*33 + (unsigned char) *s++;
+  return h & (INDEX_SIZE-1);
+}
 
 extern inline 
 struct usb2000_device *
@@ -131,6 +166,8 @@ __usb2000_dev_create(struct usb_device *dev)
 
     rv->device = dev;
     rv->buffer = malloc(PACKET_SIZE);
+    snprintf(rv->path, sizeof(rv->path), "%.15s/%.15s", 
+	     dev->bus->dirname, dev->filename);
   }
 
   return rv;
@@ -144,49 +181,78 @@ __usb2000_dev_destroy(struct usb2000_device *ptr)
   free(ptr);
 }
 
+static void
+__usb2000_serial_unindex(struct usb2000_device *dev)
+{
+  struct usb2000_device **pp = 
+    &__usb2000_serial_index[__usb2000_hash(dev->serialno)];
+
+  while (*pp) {
+    if (*pp == dev) {
+      *pp = dev->serial_next;
+      break;
+    }
+    pp = &(*pp)->serial_next;
+  }
+  dev->serial_next = NULL;
+}
+
+/* the device must not be indexed (see __usb2000_serial_unindex()) */
+static void
+__usb2000_serial_index_add(struct usb2000_device *dev)
+{
+  unsigned int h = __usb2000_hash(dev->serialno);
+
+  dev->serial_next = __usb2000_serial_index[h];
+  __usb2000_serial_index[h] = dev;
+}
+
 void
 __usb2000_dev_add(struct usb2000_device *dev)
 {
-  if  (__usb2000_devices) {
-    struct usb2000_device *ptr = __usb2000_devices;
-    while (ptr->next) ptr = ptr->next;
-    ptr->next = dev;
-  }
-  else {
-    __usb2000_devices = dev;
-  }
+  unsigned int h = __usb2000_hash(dev->path);
+
+  dev->next = NULL;
+  dev->prev = __usb2000_devices_tail;
+  if (__usb2000_devices_tail) __usb2000_devices_tail->next = dev;
+  else __usb2000_devices = dev;
+  __usb2000_devices_tail = dev;
+
+  dev->path_next = __usb2000_path_index[h];
+  __usb2000_path_index[h] = dev;
 }
 
 void
 __usb2000_dev_remove(struct usb2000_device *dev)
 {
-  struct usb2000_device *ptr = __usb2000_devices;
-  struct usb2000_device *prev = NULL;
-    
-  while (ptr) {
-    if (ptr == dev) {
-      if (prev) {
-	prev->next = ptr->next;
-      }
-      else {
-	__usb2000_devices = ptr->next;
-      }
+  struct usb2000_device **pp = &__usb2000_path_index[__usb2000_hash(dev->path)];
+
+  while (*pp) {
+    if (*pp == dev) {
+      *pp = dev->path_next;
+      break;
     }
-	
-    prev = ptr;
-    ptr = ptr->next;
+    pp = &(*pp)->path_next;
   }
+  __usb2000_serial_unindex(dev);
+
+  if (dev->prev) dev->prev->next = dev->next;
+  else __usb2000_devices = dev->next;
+  if (dev->next) dev->next->prev = dev->prev;
+  else __usb2000_devices_tail = dev->prev;
+
+  dev->next = dev->prev = dev->path_next = NULL;
 }
 
-extern inline
+static inline
 struct usb2000_device *
-__usb2000_dev_find(struct usb_device *dev)
+__usb2000_dev_find(const char *path)
 {
-  struct usb2000_device *ptr = __usb2000_devices;
+  struct usb2000_device *ptr = __usb2000_path_index[__usb2000_hash(path)];
 
   while (ptr) {
-    if (ptr->device == dev) break;
-    ptr = ptr->next;
+    if (!strcmp(ptr->path, path)) break;
+    ptr = ptr->path_next;
   }
     
   return ptr;
@@ -203,6 +269,8 @@ usb2000_finish()
     __usb2000_dev_destroy(ptr);
     ptr = nxt;
   }    
+
+  if (__usb2000_hotplug_sock >= 0) close(__usb2000_hotplug_sock);
 }
 
 void
@@ -212,46 +280,98 @@ usb2000_init()
   atexit(usb2000_finish);
 }
 
-struct usb2000_device *
-usb2000_find_devices()
+static void
+__usb2000_notify(struct usb2000_device *dev, int event)
+{
+  int i;
+  for(i=0; i<MAX_HOTPLUG; i++)
+    if (__usb2000_hotplug[i].cb)
+      __usb2000_hotplug[i].cb(dev, event, __usb2000_hotplug[i].data);
+}
+
+static inline int
+__usb2000_supported(int vendor, int product)
+{
+  if (vendor != USB2000_VENDOR_ID) return 0;
+
+  switch (product) {
+    /* FIXME not supported without respective config setting functions
+       case USB2000_PRODUCT_ID:
+       return 1;
+    */
+  case USB2000_PRODUCT_ID_EEPROM:
+  case USB2000_PRODUCT_ID_HR2000:
+    return 1;
+  }
+
+  return 0;
+}
+
+/* take @a dev found at @a path, returns 1 if it is new */
+static int
+__usb2000_arrive(struct usb_device *dev, const char *path)
+{
+  struct usb2000_device *ptr;
+
+  if ((ptr = __usb2000_dev_find(path))) {
+    ptr->device = dev;
+    ptr->seen = __usb2000_scan;
+    return 0;
+  }
+
+  if (!(ptr = __usb2000_dev_create(dev))) return 0;
+
+  msg("Found USB2000 spectrometer%s at %s\n",
+      (dev->descriptor.idProduct == USB2000_PRODUCT_ID_HR2000) 
+      ? " (HR2000)" : "", path);
+  ptr->seen = __usb2000_scan;
+  __usb2000_dev_add(ptr);
+  __usb2000_notify(ptr, USB2000_HOTPLUG_ARRIVED);
+  return 1;
+}
+
+/* @a ptr is gone, its usb_device is (or will be) freed by libusb */
+static void
+__usb2000_depart(struct usb2000_device *ptr)
+{
+  msg("Lost USB2000 spectrometer at %s\n", ptr->path);
+  __usb2000_notify(ptr, USB2000_HOTPLUG_LEFT);
+  __usb2000_dev_remove(ptr);
+  ptr->device = NULL;
+
+  /* still in use: only detach. The handle stays valid for a transfer
+     running on another thread (it fails on the dead device),
+     usb2000_close() releases both. */
+  if (ptr->handle) ptr->detached = 1;
+  else __usb2000_dev_destroy(ptr);
+}
+
+/* walk thru busses, returns number of arrivals and departures */
+static int
+__usb2000_rescan()
 {
   struct usb_bus *bus;
   struct usb_device *dev;  
+  struct usb2000_device *ptr, *nxt;
+  char path[sizeof(ptr->path)];
+  int changes;
 
-  usb_find_busses();
-  usb_find_devices();
+  /* libusb only tells how many devices came or went, not which */
+  changes = usb_find_busses();
+  changes += usb_find_devices();
+  if ((changes == 0) && __usb2000_scan) return 0;
+
+  __usb2000_scan++;
+  changes = 0;
 
-  /* walk thru busses */
   bus = usb_get_busses();
   while (bus) {
     dev = bus->devices;
 
     while (dev) {
-      if (dev->descriptor.idVendor == USB2000_VENDOR_ID) {
-	int take = 0;
-
-	switch (dev->descriptor.idProduct) {
-	  /* FIXME not supported without respective config setting functions
-	     case USB2000_PRODUCT_ID:
-	     msg("Found USB2000 spectrometer (w/o EEPROM)\n");
-	     take = 1;
-	     break;
-	  */
-	case USB2000_PRODUCT_ID_EEPROM:
-	  msg("Found USB2000 spectrometer\n");
-	  take = 1;
-	  break;
-	case USB2000_PRODUCT_ID_HR2000:
-	  msg("Found USB2000 spectrometer (HR2000)\n");
-	  take = 1;
-	  break;
-	}
-	
-	if (take) {
-	  if (__usb2000_dev_find(dev) == NULL) {
-	    __usb2000_dev_add(__usb2000_dev_create(dev));
-	  }
-	}
+      if (__usb2000_supported(dev->descriptor.idVendor, dev->descriptor.idProduct)) {
+	snprintf(path, sizeof(path), "%.15s/%.15s", bus->dirname, dev->filename);
+	changes += __usb2000_arrive(dev, path);
       }
 
       dev = dev->next;
@@ -260,9 +380,179 @@ usb2000_find_devices()
     bus = bus->next;
   }
 
+  /* whatever was not seen is gone */
+  for(ptr=__usb2000_devices; ptr; ptr=nxt) {
+    nxt = ptr->next;
+    if (ptr->seen == __usb2000_scan) continue;
+
+    __usb2000_depart(ptr);
+    changes++;
+  }
+
+  return changes;
+}
+
+#ifdef HAVE_LINUX_NETLINK_H
+/* handle one "action@devpath" uevent followed by KEY=VALUE strings,
+   returns number of arrivals and departures. The "bus/device" key comes
+   straight from BUSNUM/DEVNUM, so a departure is a single index lookup
+   and libusb is only asked on the arrival of a supported device. */
+static int
+__usb2000_uevent(char *buf, int len)
+{
+  struct usb_bus *bus;
+  struct usb_device *dev;
+  char path[sizeof(((struct usb2000_device *) 0)->path)];
+  char *p;
+  char *action = NULL, *devtype = NULL, *product = NULL;
+  int busnum = -1, devnum = -1;
+  unsigned int vendor, prod;
+  struct usb2000_device *ptr;
+
+  for(p=buf; p<buf+len; p+=strlen(p)+1) {
+    if (!strncmp(p, "ACTION=", 7)) action = p+7;
+    else if (!strncmp(p, "DEVTYPE=", 8)) devtype = p+8;
+    else if (!strncmp(p, "PRODUCT=", 8)) product = p+8;
+    else if (!strncmp(p, "BUSNUM=", 7)) busnum = atoi(p+7);
+    else if (!strncmp(p, "DEVNUM=", 7)) devnum = atoi(p+7);
+  }
+
+  /* interface events of the same plug carry no bus numbers */
+  if (!action || !devtype || strcmp(devtype, "usb_device") ||
+      (busnum < 0) || (devnum < 0))
+    return 0;
+  snprintf(path, sizeof(path), "%03d/%03d", busnum, devnum);
+
+  if (!strcmp(action, "remove")) {
+    if (!(ptr = __usb2000_dev_find(path))) return 0;
+    __usb2000_depart(ptr);
+    return 1;
+  }
+
+  if (strcmp(action, "add") || !product ||
+      (sscanf(product, "%x/%x", &vendor, &prod) != 2) ||
+      !__usb2000_supported(vendor, prod) ||
+      __usb2000_dev_find(path))
+    return 0;
+
+  /* libusb 0.1 cannot look up a single device: refresh its lists and
+     pick ours from its bus */
+  usb_find_busses();
+  usb_find_devices();
+  for(bus=usb_get_busses(); bus; bus=bus->next) {
+    if (atoi(bus->dirname) != busnum) continue;
+    for(dev=bus->devices; dev; dev=dev->next)
+      if (atoi(dev->filename) == devnum) return __usb2000_arrive(dev, path);
+  }
+
+  return 0;
+}
+#endif
+
+struct usb2000_device *
+usb2000_find_devices()
+{
+  __usb2000_rescan();
   return __usb2000_devices;
 }  
 
+struct usb2000_device *
+usb2000_find_device(const char *serialno)
+{
+  struct usb2000_device *ptr = __usb2000_serial_index[__usb2000_hash(serialno)];
+
+  while (ptr) {
+    if (!strcmp(ptr->serialno, serialno)) break;
+    ptr = ptr->serial_next;
+  }
+    
+  return ptr;
+}
+
+int
+usb2000_hotplug_register(usb2000_hotplug_cb cb, void *data)
+{
+  int i;
+  for(i=0; i<MAX_HOTPLUG; i++) {
+    if (!__usb2000_hotplug[i].cb) {
+      __usb2000_hotplug[i].cb = cb;
+      __usb2000_hotplug[i].data = data;
+      return i;
+    }
+  }
+
+  errno = ENOSPC;
+  return -1;
+}
+
+int
+usb2000_hotplug_deregister(int handle)
+{
+  if ((handle < 0) || (handle >= MAX_HOTPLUG)) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  __usb2000_hotplug[handle].cb = NULL;
+  __usb2000_hotplug[handle].data = NULL;
+  return 0;
+}
+
+int
+usb2000_hotplug_fd()
+{
+#ifdef HAVE_LINUX_NETLINK_H
+  struct sockaddr_nl addr;
+
+  if (__usb2000_hotplug_sock >= 0) return __usb2000_hotplug_sock;
+
+  __usb2000_hotplug_sock = socket(PF_NETLINK, SOCK_DGRAM, NETLINK_KOBJECT_UEVENT);
+  if (__usb2000_hotplug_sock < 0) return -1;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.nl_family = AF_NETLINK;
+  addr.nl_groups = 1; /* kernel uevents */
+  if ((bind(__usb2000_hotplug_sock, (struct sockaddr *) &addr, sizeof(addr)) < 0) ||
+      (fcntl(__usb2000_hotplug_sock, F_SETFL, O_NONBLOCK) < 0)) {
+    close(__usb2000_hotplug_sock);
+    __usb2000_hotplug_sock = -1;
+    return -1;
+  }
+
+  return __usb2000_hotplug_sock;
+#else
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+int
+usb2000_hotplug_handle_events()
+{
+  int changes = 0;
+
+  if ((__usb2000_hotplug_sock < 0) || !__usb2000_scan)
+    return __usb2000_rescan();
+
+#ifdef HAVE_LINUX_NETLINK_H
+  {
+    char buf[2048];
+    ssize_t len;
+
+    while ((len = recv(__usb2000_hotplug_sock, buf, sizeof(buf)-1, 0)) > 0) {
+      buf[len] = 0;
+      changes += __usb2000_uevent(buf, len);
+    }
+
+    /* events were dropped, we cannot tell which */
+    if ((len < 0) && (errno == ENOBUFS))
+      changes += __usb2000_rescan();
+  }
+#endif
+
+  return changes;
+}
+
 int
 usb2000_reset(struct usb2000_device *dev) {
   if (!dev->handle) {
@@ -309,6 +599,11 @@ usb2000_open(struct usb2000_device *dev)
   int len;
   int i;
 
+  if (dev->detached) {
+    errno = ENODEV;
+    return -1;
+  }
+
   dev->handle = usb_open(dev->device);
   if (!dev->handle) {
     msg("Cannot open device.\n");
@@ -408,7 +703,9 @@ usb2000_open(struct usb2000_device *dev)
 
   /* S/N */
   READ_CONFIG(0);
+  __usb2000_serial_unindex(dev);
   memcpy(dev->serialno, dev->buffer+2, INFO_SIZE);
+  __usb2000_serial_index_add(dev);
     
   /* wavelength coefficients */
   for(i=0; i<4; i++) {
@@ -457,6 +754,7 @@ usb2000_open(struct usb2000_device *dev)
   usb_release_interface(dev->handle, 0 /*@FIXME really hardcode ?*/);
     
  open_failure:
+  __usb2000_serial_unindex(dev);
   usb_close(dev->handle);
   dev->handle = NULL;
   errno = status;
@@ -480,6 +778,10 @@ usb2000_set_integration_time(struct usb2000_device *dev, int ms)
 {
   int status;
   u_int16_t it = (u_int16_t) ms;
+  if (!dev->handle) {
+    errno = ENXIO;
+    return -1;
+  }
   if ((ms < 3) || (ms > 65535)) {
     errno = EINVAL;
     return -1;
@@ -511,6 +813,10 @@ int
 usb2000_set_trigger_mode(struct usb2000_device *dev, int tm) 
 {
   int status;
+  if (!dev->handle) {
+    errno = ENXIO;
+    return -1;
+  }
   if ((tm<0) || (tm>3) || (tm == 1)) {
     errno = EINVAL;
     return -1;
@@ -567,6 +873,15 @@ usb2000_get_trigger_mode(struct usb2000_device *dev)
 int
 usb2000_close(struct usb2000_device *dev)
 {
+  if (dev->detached) {
+    /* unplugged while open, already unlinked by the rescan */
+    usb_close(dev->handle);
+    __usb2000_dev_destroy(dev);
+    return 0;
+  }
+
+  __usb2000_serial_unindex(dev);
+
   usb_resetep(dev->handle, EP2);
   usb_resetep(dev->handle, EP7);
 
@@ -606,17 +921,66 @@ usb2000_get_linear_correction(struct usb2000_device *dev, double *arr)
   }
 }
 
+/* accumulate quality info over @a n freshly converted pixels at @a base */
+static inline void
+quality_update(struct usb2000_quality *q, const u_int16_t *arr, int base, int n)
+{
+  int i;
+  int max = q->max;
+  int max_index = q->max_index;
+  long sum = 0;
+
+  for(i=base; i<base+n; i++) {
+    int v = arr[i];
+    sum += v;
+    if (v > max) {
+      max = v;
+      max_index = i;
+    }
+    if (v >= FULL_SCALE) {
+      q->saturated++;
+      q->saturated_mask[i >> 5] |= ((u_int32_t) 1) << (i & 31);
+    }
+  }
+
+  q->sum += sum;
+  q->max = max;
+  q->max_index = max_index;
+}
+
 void
 usb2000_get_spectrum_raw(struct usb2000_device *dev, u_int16_t *arr)
 { 
-  int count;
+  usb2000_get_spectrum_raw_quality(dev, arr, NULL);
+}
+
+int
+usb2000_get_spectrum_raw_quality(struct usb2000_device *dev, u_int16_t *arr,
+				 struct usb2000_quality *q)
+{ 
+  int count, status;
+  int retries = 0;
   int i,n,off;
   u_int8_t *out = (u_int8_t *) arr;
 
+  if (q) {
+    memset(q, 0, sizeof(struct usb2000_quality));
+    q->max = -1;
+  }
+
+  if (!dev->handle) {
+    errno = ENXIO;
+    return -1;
+  }
+
   USB2000_COMMAND1(dev, 
 		   CMD_GET_SPECTRA, 
-		   count);
-  /*@FIXME error check*/
+		   status);
+  if (status) {
+    msg("Requesting spectrum failed: %s\n", usb_strerror());
+    errno = status;
+    return -1;
+  }
 
   /* we expect 64 data packets and a sync packet */
   for(i=0; i<=64; i++) {
@@ -629,11 +993,25 @@ usb2000_get_spectrum_raw(struct usb2000_device *dev, u_int16_t *arr)
       if (count != PACKET_SIZE) {
 	if ((count == 1) && (dev->buffer[0] == 0x69)) {
 	  msg("*** received sync packet???");
-	  return /*@FIXME*/;
+	  if (q) q->flags |= USB2000_QUALITY_PREMATURE_SYNC;
+	  errno = EIO;
+	  return -1;
 	}
 
 	msg("*** PACKET ERROR (%s)", usb_strerror());
-	/*@FIXME this may loop forever!!!!*/
+	/* timeout or device gone: nothing more will come */
+	if (count < 0) {
+	  errno = EIO;
+	  return -1;
+	}
+	if (q) {
+	  q->flags |= USB2000_QUALITY_SHORT_PACKET;
+	  q->short_packets++;
+	}
+	if (++retries > PACKET_RETRIES) {
+	  errno = EIO;
+	  return -1;
+	}
 	i--;
 	continue;
       }
@@ -643,6 +1021,9 @@ usb2000_get_spectrum_raw(struct usb2000_device *dev, u_int16_t *arr)
       if (i & 0x01) {
 	for(n=0; n<PACKET_SIZE; n++) 
 	  out[off + 2*n + MSB] = dev->buffer[n];
+
+	/* pixels of this packet pair are complete and still in cache */
+	if (q) quality_update(q, arr, off/2, PACKET_SIZE);
       }
       else {
 	for(n=0; n<PACKET_SIZE; n++) 
@@ -655,31 +1036,43 @@ usb2000_get_spectrum_raw(struct usb2000_device *dev, u_int16_t *arr)
 			    dev->buffer, SYNC_SIZE,
 			    dev->itime+100);
       msg("Finished sync packet with count=%d\n", i, count);
-      if (dev->buffer[0] != 0x69) {
+      if ((count != SYNC_SIZE) || (dev->buffer[0] != 0x69)) {
 	msg("Sync packet missed.\n");
-	return /*@FIXME*/;
+	if (q) q->flags |= USB2000_QUALITY_SYNC_MISSED;
+	errno = EIO;
+	return -1;
       }
     }
   }
+
+  return 0;
 }
 
 void
-usb2000_get_spectrum(struct usb2000_device *dev, double *linear_correction, double *result)
+usb2000_convert_spectrum(const u_int16_t *raw, double *linear_correction, double *result)
 {
   int i;
-  u_int16_t buf[USB2000_FMT_BINS];
 
   double maxval = D((1<<USB2000_FMT_BITS)-1);
 
-  /* get raw spectrum */
-  usb2000_get_spectrum_raw(dev, buf);
-
   /* FIXME correct maxval if linear_correction present */
 
   /* calculate */
   for(i=0; i<USB2000_FMT_BINS; i++) {
-    result[i] = D(buf[i])/maxval;
+    result[i] = D(raw[i])/maxval;
+    /* never index the correction table with garbage */
     if (linear_correction)
-      result[i] *= linear_correction[(int) buf[i]];
+      result[i] *= linear_correction[(raw[i] > FULL_SCALE) ? FULL_SCALE : (int) raw[i]];
   }
 }
+
+void
+usb2000_get_spectrum(struct usb2000_device *dev, double *linear_correction, double *result)
+{
+  u_int16_t buf[USB2000_FMT_BINS];
+
+  /* get raw spectrum */
+  usb2000_get_spectrum_raw(dev, buf);
+
+  usb2000_convert_spectrum(buf, linear_correction, result);
+}
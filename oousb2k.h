@@ -87,6 +87,14 @@ struct usb2000_device
   usb_dev_handle *handle;        /**< @internal usb library handle */
 
   char *buffer;                  /**< @internal device buffer for control and data send/recv operations */
+
+  struct usb2000_device *prev;   /**< @internal Previous device in list */
+  struct usb2000_device *path_next;   /**< @internal Bus path index chain */
+  struct usb2000_device *serial_next; /**< @internal Serial number index chain */
+  int   seen;                    /**< @internal Last scan the device was seen at */
+
+  char  path[32];                /**< Bus path ("bus/device") the device was found at */
+  int   detached;                /**< Set if the device was unplugged while open */
 };
 
 /** Initialize library (this also initializes the usb library) */
@@ -94,6 +102,28 @@ void                          usb2000_init();
 
 /** Find an USB2000 device */
 struct usb2000_device        *usb2000_find_devices();
+/** Find an opened device by serial number */
+struct usb2000_device        *usb2000_find_device(const char *serialno);
+
+/* hotplug */
+/** Hotplug event: device arrived */
+#define USB2000_HOTPLUG_ARRIVED  1
+/** Hotplug event: device left. @a dev is unlinked and destroyed after the
+    callback; if it is open it is only detached and usb2000_close() destroys it */
+#define USB2000_HOTPLUG_LEFT     2
+
+/** Hotplug callback, @a event is one of USB2000_HOTPLUG_* */
+typedef void (*usb2000_hotplug_cb)(struct usb2000_device *dev, int event, void *data);
+
+/** Register a hotplug callback, returns handle for usb2000_hotplug_deregister() */
+int                           usb2000_hotplug_register(usb2000_hotplug_cb cb, void *data);
+/** Remove a hotplug callback */
+int                           usb2000_hotplug_deregister(int handle);
+/** File descriptor that gets readable on USB hotplug events (Linux only) */
+int                           usb2000_hotplug_fd();
+/** Update the device list (on pending events only if usb2000_hotplug_fd() is used),
+    returns number of arrivals and departures */
+int                           usb2000_hotplug_handle_events();
 
 /* * Reset the device connection */
 /* FIXME int                           usb2000_reset(struct usb2000_device *dev);*/
@@ -122,8 +152,33 @@ int                           usb2000_get_strobe_enable(struct usb2000_device *d
 /** Get trigger mode (if previously set) */
 int                           usb2000_get_trigger_mode(struct usb2000_device *dev);
 
+/* frame quality flags */
+/** Quality: a data packet was short and had to be read again */
+#define USB2000_QUALITY_SHORT_PACKET    0x01
+/** Quality: sync packet arrived before all data packets */
+#define USB2000_QUALITY_PREMATURE_SYNC  0x02
+/** Quality: sync packet missing or wrong after the data packets */
+#define USB2000_QUALITY_SYNC_MISSED     0x04
+
+/** @struct usb2000_quality
+ *  @brief Per-frame quality record (see usb2000_get_spectrum_raw_quality())
+ */
+struct usb2000_quality
+{
+  int       flags;               /**< USB2000_QUALITY_* anomalies seen during transfer */
+  int       short_packets;       /**< Number of short data packets */
+  int       saturated;           /**< Number of pixels at full scale */
+  u_int32_t saturated_mask[USB2000_FMT_BINS/32]; /**< Bit (i%32) of word i/32 set if pixel i is saturated */
+  int       max;                 /**< Largest pixel value */
+  int       max_index;           /**< Index of (first) largest pixel */
+  long      sum;                 /**< Sum over all pixels */
+};
+
 /** Get the raw spectrum from device */
 void                          usb2000_get_spectrum_raw(struct usb2000_device *dev, u_int16_t *arr);
+/** Get the raw spectrum and fill @a q (if not NULL) during conversion, fails with EIO
+    on a timeout, a lost device or repeated short packets */
+int                           usb2000_get_spectrum_raw_quality(struct usb2000_device *dev, u_int16_t *arr, struct usb2000_quality *q);
 
 /** Get the wavelength->pixel mapping (@a arr has to of size USB2000_FMT_BINS) */
 void                          usb2000_get_wavelength(struct usb2000_device *dev, double *arr);
@@ -131,7 +186,218 @@ void                          usb2000_get_wavelength(struct usb2000_device *dev,
 /** Get the linearity correction mapping (@a arr has to of size 1<<USB2000_FMT_BITS) */
 void                          usb2000_get_linear_correction(struct usb2000_device *dev, double *arr);
 
+/** Get a spectrum scaled to [0,1] and corrected with @a linear_correction (may be NULL) */
 void                          usb2000_get_spectrum(struct usb2000_device *dev, double *linear_correction, double *result);
+/** Convert a raw spectrum like usb2000_get_spectrum() does */
+void                          usb2000_convert_spectrum(const u_int16_t *raw, double *linear_correction, double *result);
+
+/* auto-exposure */
+/** @struct usb2000_exposure
+ *  @brief Auto-exposure controller state (see usb2000_exposure_init())
+ */
+struct usb2000_exposure
+{
+  int    roi_start;              /**< First pixel of the peak search region */
+  int    roi_end;                /**< One past the last pixel of the peak search region */
+  double target;                 /**< Target peak level as fraction of full scale */
+  double tolerance;              /**< Accepted deviation from target as fraction of full scale */
+  int    dark;                   /**< Dark level (counts) subtracted before scaling */
+  int    min_itime;              /**< Shortest integration time to use (ms) */
+  int    max_itime;              /**< Longest integration time to use (ms) */
+
+  /* private: */
+  int    lo;                     /**< @internal Longest integration time seen unsaturated */
+  int    hi;                     /**< @internal Shortest integration time seen saturated */
+  int    peak;                   /**< Peak counts in the region of the last frame */
+  int    frames;                 /**< Frames taken by the last usb2000_autoexpose() */
+  int    converged;              /**< Set when the last frame was within tolerance */
+};
+
+/** Initialize auto-exposure state for pixels [@a roi_start, @a roi_end) */
+void                          usb2000_exposure_init(struct usb2000_exposure *ae, int roi_start, int roi_end);
+/** Feed a raw frame taken at @a itime ms, returns the next integration time */
+int                           usb2000_exposure_update(struct usb2000_exposure *ae, const u_int16_t *arr, int itime);
+/** Acquire frames into @a arr until exposure converges (at most @a max_frames),
+    fails with ERANGE if it does not or the frame saturates at the shortest time,
+    and like usb2000_get_spectrum_raw_quality() if acquisition fails */
+int                           usb2000_autoexpose(struct usb2000_device *dev, struct usb2000_exposure *ae, u_int16_t *arr, int max_frames);
+
+/* per-pixel statistics */
+/** @struct usb2000_stats
+ *  @brief Running per-pixel statistics over raw frames (see usb2000_stats_init())
+ */
+struct usb2000_stats
+{
+  long      count;                      /**< Number of frames accumulated */
+  double    alpha;                      /**< Weight of the newest frame in ewma (0 disables) */
+
+  double    mean[USB2000_FMT_BINS];     /**< Running mean */
+  double    m2[USB2000_FMT_BINS];       /**< @internal Sum of squared deviations from mean */
+  double    ewma[USB2000_FMT_BINS];     /**< Exponentially weighted mean */
+  u_int16_t min[USB2000_FMT_BINS];      /**< Smallest value seen */
+  u_int16_t max[USB2000_FMT_BINS];      /**< Largest value seen */
+};
+
+/** Reset statistics, @a alpha is the exponential weight (0 to disable) */
+void                          usb2000_stats_init(struct usb2000_stats *st, double alpha);
+/** Accumulate a raw frame */
+void                          usb2000_stats_update(struct usb2000_stats *st, const u_int16_t *arr);
+/** Merge statistics of @a src into @a dst (e.g. from another thread or device) */
+void                          usb2000_stats_merge(struct usb2000_stats *dst, const struct usb2000_stats *src);
+/** Get the sample variance (@a arr has to of size USB2000_FMT_BINS) */
+void                          usb2000_stats_variance(const struct usb2000_stats *st, double *arr);
+
+/* peak detection */
+/** Peak centroid: parabola through the three top pixels */
+#define USB2000_PEAK_PARABOLIC  0
+/** Peak centroid: gaussian through the three top pixels */
+#define USB2000_PEAK_GAUSSIAN   1
+
+/** @struct usb2000_peak
+ *  @brief Peak found by usb2000_find_peaks()
+ */
+struct usb2000_peak
+{
+  int    index;                  /**< Pixel of the local maximum */
+  double pixel;                  /**< Sub-pixel centroid */
+  double wavelength;             /**< Wavelength at centroid */
+  double height;                 /**< Interpolated height at centroid */
+  double prominence;             /**< Height above the higher of the two enclosing minima */
+  int    lost;                   /**< Set by usb2000_track_peaks() if not found in its window or below threshold or prominence (values are kept) */
+};
+
+/** Find up to @a max peaks in @a spectrum, returns number found */
+int                           usb2000_find_peaks(struct usb2000_device *dev, const double *spectrum, double threshold, double prominence, int mode, struct usb2000_peak *peaks, int max);
+/** Update @a n peaks searching @a window pixels around their last position,
+    @a threshold and @a prominence as for usb2000_find_peaks(), returns number not lost */
+int                           usb2000_track_peaks(struct usb2000_device *dev, const double *spectrum, double threshold, double prominence, int window, int mode, struct usb2000_peak *peaks, int n);
+
+/* resampling */
+/** Resampling: linear interpolation between neighbouring pixels */
+#define USB2000_RESAMPLE_LINEAR  0
+/** Resampling: cubic (Catmull-Rom) interpolation over four pixels */
+#define USB2000_RESAMPLE_CUBIC   1
+
+/** @struct usb2000_resample_plan
+ *  @brief Precomputed weights mapping pixels onto a uniform wavelength grid
+ */
+struct usb2000_resample_plan
+{
+  struct usb2000_resample_plan *next; /**< @internal Plan cache list */
+
+  char    serialno[18];          /**< Serial number of the device the plan was made for */
+  double  start;                 /**< First wavelength of the grid */
+  double  step;                  /**< Wavelength step of the grid */
+  int     n;                     /**< Number of grid points */
+  int     method;                /**< USB2000_RESAMPLE_* */
+
+  /* private: */
+  double  lambda[4];             /**< @internal Wavelength coefficients the plan was made from */
+  int     taps;                  /**< @internal Pixels per grid point */
+  int    *index;                 /**< @internal First pixel per grid point */
+  double *weight;                /**< @internal taps weights per grid point */
+};
+
+/** Create a plan for @a n points from @a start in steps of @a step */
+struct usb2000_resample_plan *usb2000_resample_plan_create(struct usb2000_device *dev, double start, double step, int n, int method);
+/** Destroy a plan from usb2000_resample_plan_create() */
+void                          usb2000_resample_plan_destroy(struct usb2000_resample_plan *plan);
+/** Like usb2000_resample_plan_create(), but shared per serial number (do not destroy),
+    thread safe. A plan made before the device was recalibrated is replaced and destroyed. */
+struct usb2000_resample_plan *usb2000_resample_plan_get(struct usb2000_device *dev, double start, double step, int n, int method);
+/** Destroy all shared plans */
+void                          usb2000_resample_flush();
+
+/** Resample @a in (size USB2000_FMT_BINS) to @a out (size plan->n) */
+void                          usb2000_resample(const struct usb2000_resample_plan *plan, const double *in, double *out);
+/** Resample a raw frame */
+void                          usb2000_resample_raw(const struct usb2000_resample_plan *plan, const u_int16_t *in, double *out);
+
+/* smoothing and derivative filters */
+/** Filter: Savitzky-Golay polynomial fit (supports derivatives) */
+#define USB2000_FILTER_SAVGOL    0
+/** Filter: moving average */
+#define USB2000_FILTER_BOXCAR    1
+/** Filter: gaussian (width = half window / 2) */
+#define USB2000_FILTER_GAUSSIAN  2
+
+/** @struct usb2000_filter
+ *  @brief Precomputed filter kernel (see usb2000_filter_create())
+ */
+struct usb2000_filter
+{
+  int     type;                  /**< USB2000_FILTER_* */
+  int     half;                  /**< Half window, kernel is 2*half+1 pixels */
+  int     order;                 /**< Polynomial order (Savitzky-Golay) */
+  int     deriv;                 /**< Derivative order (Savitzky-Golay) */
+
+  /* private: */
+  double *coeff;                 /**< @internal 2*half+1 rows of 2*half+1 coefficients, row half is the centre kernel */
+};
+
+/** Create a filter of window 2*@a half+1, @a order and @a deriv are used by Savitzky-Golay only */
+struct usb2000_filter        *usb2000_filter_create(int type, int half, int order, int deriv);
+/** Destroy a filter from usb2000_filter_create() */
+void                          usb2000_filter_destroy(struct usb2000_filter *f);
+/** Filter @a n consecutive frames from @a in to @a out (may be the same), @a f is
+    not modified and may be shared between threads */
+void                          usb2000_filter_apply(const struct usb2000_filter *f, const double *in, double *out, int n);
+/** Filter @a n consecutive raw frames */
+void                          usb2000_filter_apply_raw(const struct usb2000_filter *f, const u_int16_t *in, double *out, int n);
+
+/* spectral library matching */
+/** Match metric: cosine similarity (higher is better) */
+#define USB2000_MATCH_COSINE       0
+/** Match metric: Pearson correlation (higher is better) */
+#define USB2000_MATCH_CORRELATION  1
+/** Match metric: euclidean distance (lower is better) */
+#define USB2000_MATCH_EUCLIDEAN    2
+
+/** Number of blocks used for early rejection while scoring */
+#define USB2000_MATCH_BLOCKS       8
+
+/** @struct usb2000_match
+ *  @brief Result of usb2000_library_match()
+ */
+struct usb2000_match
+{
+  int    index;                  /**< Reference index as returned by usb2000_library_add() */
+  double score;                  /**< Similarity or distance, see USB2000_MATCH_* */
+};
+
+/** @struct usb2000_library
+ *  @brief Reference spectra on a device's wavelength axis (see usb2000_library_create())
+ */
+struct usb2000_library
+{
+  int     metric;                /**< USB2000_MATCH_* */
+  int     threads;               /**< Number of threads used for scoring */
+  int     n;                     /**< Number of references */
+
+  /* private: */
+  int     size;                  /**< @internal Allocated references */
+  double  wl[USB2000_FMT_BINS];  /**< @internal Device wavelength axis */
+  double *ref;                   /**< @internal n rows of USB2000_FMT_BINS (normalized) values */
+  double *tail;                  /**< @internal n rows of USB2000_MATCH_BLOCKS+1 tail norms */
+};
+
+/** Create an empty library on the wavelength axis of @a dev */
+struct usb2000_library       *usb2000_library_create(struct usb2000_device *dev, int metric, int threads);
+/** Destroy a library from usb2000_library_create() */
+void                          usb2000_library_destroy(struct usb2000_library *lib);
+/** Add a reference of @a len points at wavelengths @a wl (NULL: already on the device axis), returns its index */
+int                           usb2000_library_add(struct usb2000_library *lib, const double *wl, const double *val, int len);
+/** Find the @a k best references for @a spectrum, returns number of matches in @a out */
+int                           usb2000_library_match(struct usb2000_library *lib, const double *spectrum, int k, struct usb2000_match *out);
+
+/* batch reprocessing */
+/** Reprocessing: apply the linearity correction of the device */
+#define USB2000_REPROCESS_LINEAR  0x01
+
+/** Convert raw frames read from @a in to spectra written to @a out in order,
+    using @a threads threads, returns number of frames (fails with EIO if the
+    last frame is incomplete) */
+long                          usb2000_reprocess(struct usb2000_device *dev, FILE *in, FILE *out, int threads, int flags);
 
 __END_DECLS
 
@@ -0,0 +1,302 @@
+/* oousb2k.hpp - C++ interface for the Ocean Optics USB2000 spectrometer
+ *
+ * Copyright (C) 2026 The liboousb2k authors
+ * All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef OCEANOPTICS_USB2000_LIB_HPP
+#define OCEANOPTICS_USB2000_LIB_HPP
+
+/* header only, needs C++17 */
+
+#include <cstdio>
+#include <cstddef>
+#include <cerrno>
+#include <array>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <algorithm>
+#include <system_error>
+
+#include "oousb2k.h"
+
+namespace usb2000 {
+
+/** Number of pixels per spectrum acquisition */
+constexpr std::size_t bins = USB2000_FMT_BINS;
+/** Number of entries of a linearity correction table */
+constexpr std::size_t levels = std::size_t(1) << USB2000_FMT_BITS;
+/** Largest raw count */
+constexpr int full_scale = (1 << USB2000_FMT_BITS) - 1;
+
+/** @class span
+ *  @brief Non-owning view of caller storage
+ */
+template<class T>
+class span
+{
+public:
+  span(T *data, std::size_t size) : data_(data), size_(size) {}
+  template<std::size_t N>
+  span(std::array<typename std::remove_const<T>::type, N> &a) : data_(a.data()), size_(N) {}
+  template<std::size_t N>
+  span(const std::array<typename std::remove_const<T>::type, N> &a) : data_(a.data()), size_(N) {}
+  template<std::size_t N>
+  span(T (&a)[N]) : data_(a), size_(N) {}
+  template<class U, class = typename std::enable_if<std::is_convertible<U *, T *>::value>::type>
+  span(const span<U> &o) : data_(o.data()), size_(o.size()) {}
+
+  T *data() const { return data_; }
+  std::size_t size() const { return size_; }
+  T &operator[](std::size_t i) const { return data_[i]; }
+
+private:
+  T *data_;
+  std::size_t size_;
+};
+
+namespace detail {
+
+[[noreturn]] inline void
+raise(int code, const char *what)
+{
+  throw std::system_error(code ? code : EIO, std::generic_category(), what);
+}
+
+template<class T>
+inline void
+check_size(const span<T> &s, std::size_t n, const char *what)
+{
+  if (s.size() < n) raise(EINVAL, what);
+}
+
+} /* namespace detail */
+
+/** @class device
+ *  @brief Opened USB2000 device, closed on destruction (move only)
+ *
+ *  A moved-from device raises ENXIO on use.
+ */
+class device
+{
+public:
+  /** Open @a dev as found with usb2000_find_devices() */
+  explicit device(usb2000_device *dev) : dev_(dev)
+  {
+    int status = usb2000_open(dev_);
+    if (status) {
+      dev_ = nullptr;
+      detail::raise((status > 0) ? status : errno, "usb2000_open");
+    }
+  }
+
+  /** Open the first device found */
+  static device first()
+  {
+    usb2000_device *dev = usb2000_find_devices();
+    if (!dev) detail::raise(ENODEV, "usb2000_find_devices");
+    return device(dev);
+  }
+
+  ~device() { if (dev_) usb2000_close(dev_); }
+
+  device(const device &) = delete;
+  device &operator=(const device &) = delete;
+
+  device(device &&o) noexcept : dev_(o.dev_) { o.dev_ = nullptr; }
+  device &operator=(device &&o) noexcept
+  {
+    if (this != &o) {
+      if (dev_) usb2000_close(dev_);
+      dev_ = o.dev_;
+      o.dev_ = nullptr;
+    }
+    return *this;
+  }
+
+  /** Underlying C device (nullptr if moved from) */
+  usb2000_device *get() const { return dev_; }
+  /** Serial number */
+  const char *serialno() const { return checked()->serialno; }
+
+  /** Set the integration time in ms */
+  void integration_time(int ms)
+  {
+    if (usb2000_set_integration_time(checked(), ms))
+      detail::raise(errno, "usb2000_set_integration_time");
+  }
+  /** Get integration time */
+  int integration_time() const { return checked()->itime; }
+
+  /** Acquire a raw spectrum into @a out (at least bins entries) */
+  void acquire(span<u_int16_t> out)
+  {
+    detail::check_size(out, bins, "usb2000::device::acquire");
+    if (usb2000_get_spectrum_raw_quality(checked(), out.data(), nullptr))
+      detail::raise(errno, "usb2000_get_spectrum_raw");
+  }
+  /** Acquire a raw spectrum and its quality record */
+  void acquire(span<u_int16_t> out, usb2000_quality &q)
+  {
+    detail::check_size(out, bins, "usb2000::device::acquire");
+    if (usb2000_get_spectrum_raw_quality(checked(), out.data(), &q))
+      detail::raise(errno, "usb2000_get_spectrum_raw");
+  }
+
+  /** Wavelength axis into @a out (at least bins entries) */
+  void wavelength(span<double> out) const
+  {
+    detail::check_size(out, bins, "usb2000::device::wavelength");
+    usb2000_get_wavelength(checked(), out.data());
+  }
+  /** Linearity correction table into @a out (at least levels entries) */
+  void linear_correction(span<double> out) const
+  {
+    detail::check_size(out, levels, "usb2000::device::linear_correction");
+    std::fill(out.data(), out.data() + levels, 0.0);
+    usb2000_get_linear_correction(checked(), out.data());
+  }
+
+private:
+  usb2000_device *checked() const
+  {
+    if (!dev_) detail::raise(ENXIO, "usb2000::device");
+    return dev_;
+  }
+
+  usb2000_device *dev_;
+};
+
+/* pipeline stages: each maps (pixel, raw count, value) to a new value */
+
+/** Stage: scale to [0,1] as usb2000_get_spectrum() does */
+struct normalize
+{
+  template<class T>
+  T operator()(std::size_t, u_int16_t, T v) const { return v*(T(1)/T(full_scale)); }
+};
+
+/** Stage: multiply by a linearity correction table indexed by raw count */
+struct linearity
+{
+  explicit linearity(const double *table) : table(table) {}
+  template<class T>
+  T operator()(std::size_t, u_int16_t raw, T v) const { return v*T(table[raw]); }
+
+  const double *table;           /**< levels entries, see device::linear_correction() */
+};
+
+/** Stage: subtract a per-pixel dark spectrum (same units as the value at this stage) */
+template<class D = double>
+struct dark_subtract
+{
+  explicit dark_subtract(const D *dark) : dark(dark) {}
+  template<class T>
+  T operator()(std::size_t i, u_int16_t, T v) const { return v - T(dark[i]); }
+
+  const D *dark;                 /**< bins entries, indexed by pixel */
+};
+
+/** Stage: restrict output to pixels [Begin, End) */
+template<std::size_t Begin, std::size_t End>
+struct roi
+{
+  static_assert(Begin < End && End <= bins, "bad region of interest");
+  template<class T>
+  T operator()(std::size_t, u_int16_t, T v) const { return v; }
+};
+
+namespace detail {
+
+template<class S> struct roi_of
+{
+  static constexpr std::size_t begin = 0;
+  static constexpr std::size_t end = bins;
+};
+template<std::size_t B, std::size_t E> struct roi_of<roi<B, E> >
+{
+  static constexpr std::size_t begin = B;
+  static constexpr std::size_t end = E;
+};
+
+} /* namespace detail */
+
+/** @class pipeline
+ *  @brief Per-frame processing chain composed at compile time
+ *
+ *  Stages are applied in order to every pixel; the loop has no per-pixel
+ *  dispatch so the compiler can inline and vectorize the whole chain.
+ *  The output covers the intersection of all roi<> stages.
+ */
+template<class Out, class... Stages>
+class pipeline
+{
+public:
+  /** First pixel written */
+  static constexpr std::size_t begin = std::max({std::size_t(0), detail::roi_of<Stages>::begin...});
+  /** One past the last pixel written */
+  static constexpr std::size_t end = std::min({bins, detail::roi_of<Stages>::end...});
+  /** Number of output values per frame */
+  static constexpr std::size_t size = end - begin;
+
+  static_assert(begin < end, "empty region of interest");
+
+  explicit pipeline(Stages... stages) : stages_(stages...) {}
+
+  /** Process one raw frame into @a out (at least size entries) */
+  void operator()(span<const u_int16_t> raw, span<Out> out) const
+  {
+    detail::check_size(raw, bins, "usb2000::pipeline");
+    detail::check_size(out, size, "usb2000::pipeline");
+    run(raw.data(), out.data(), std::index_sequence_for<Stages...>());
+  }
+
+  /** Process @a n consecutive raw frames into @a n consecutive outputs */
+  void operator()(span<const u_int16_t> raw, span<Out> out, std::size_t n) const
+  {
+    detail::check_size(raw, n*bins, "usb2000::pipeline");
+    detail::check_size(out, n*size, "usb2000::pipeline");
+    for (std::size_t f = 0; f < n; f++)
+      run(raw.data() + f*bins, out.data() + f*size, std::index_sequence_for<Stages...>());
+  }
+
+private:
+  template<std::size_t... I>
+  void run(const u_int16_t *raw, Out *out, std::index_sequence<I...>) const
+  {
+    for (std::size_t i = begin; i < end; i++) {
+      Out v = Out(raw[i]);
+      ((v = std::get<I>(stages_)(i, raw[i], v)), ...);
+      out[i - begin] = v;
+    }
+  }
+
+  std::tuple<Stages...> stages_;
+};
+
+/** Build a pipeline producing @a Out values, e.g.
+    make_pipeline<float>(linearity(tab), normalize(), roi<100, 1900>()) */
+template<class Out, class... Stages>
+pipeline<Out, Stages...>
+make_pipeline(Stages... stages)
+{
+  return pipeline<Out, Stages...>(stages...);
+}
+
+} /* namespace usb2000 */
+
+#endif